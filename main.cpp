@@ -2,10 +2,25 @@
 #include <cstdint>
 #include <stdlib.h>
 #include <cstring>
+#include <cmath>
+#include <ctime>
+#if defined(__SSE2__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define PARTICLES_X86       // SSE2 kernel always, AVX2 kernel when the CPU has it (picked at runtime)
+#endif
+#ifdef USE_TERMINAL
+#include <cerrno>
+#include <csignal>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#else
 #include <GL/glew.h>
 #include <GLFW/glfw3.h> 
+#endif
 
 //g++ -o main main.cpp -I/opt/homebrew/Cellar/glfw/3.3.8/include -I/opt/homebrew/Cellar/glew/2.2.0_1/include -L/opt/homebrew/Cellar/glfw/3.3.8/lib -L/opt/homebrew/Cellar/glew/2.2.0_1/lib -lglfw -lGLEW -framework OpenGL
+//g++ -DUSE_TERMINAL -O2 -o main main.cpp      (terminal renderer, no GLFW / GLEW / OpenGL needed)
 bool game_running = false;
 int mov_dir       = 0;
 bool fire_pressed = false;
@@ -15,6 +30,15 @@ struct Buffer {
     uint32_t *data;
 };
 
+/*
+    * Optional companion of a Buffer with the same size. Every pixel holds the entity that drew it (index + 1), 0 for none
+    ! Filled by buffer_draw_sprite while drawing, so hits can be found by looking at a few pixels instead of testing every entity
+*/
+struct IdBuffer {
+    size_t width, height;
+    uint16_t *data;
+};
+
 struct Sprite {
     size_t width, height;
     uint8_t *data;
@@ -74,6 +98,31 @@ bool sprite_overlap_check(const Sprite &sp_a, size_t x_a, size_t y_a,
     return false;
 }
 
+/* 
+    * Pixel exact version of sprite_overlap_check, true only if a lit pixel of one sprite lands on a lit pixel of the other
+    ! Sprite rows are stored top row first while (x, y) is the bottom-left corner, same as in buffer_draw_sprite
+*/
+bool sprite_pixel_overlap_check(const Sprite &sp_a, size_t x_a, size_t y_a,
+                                const Sprite &sp_b, size_t x_b, size_t y_b) {
+    if (!sprite_overlap_check(sp_a, x_a, y_a, sp_b, x_b, y_b)) return false;
+
+    for (size_t yi = 0; yi < sp_a.height; yi ++) {
+        for (size_t xi = 0; xi < sp_a.width; xi ++) {
+            if (sp_a.data[yi * sp_a.width + xi] != 1) continue;
+
+            size_t sx = x_a + xi;
+            size_t sy = y_a + sp_a.height - 1 - yi;
+            if (sx < x_b || sx >= x_b + sp_b.width || sy < y_b || sy >= y_b + sp_b.height) continue;
+
+            size_t bx = sx - x_b;
+            size_t by = y_b + sp_b.height - 1 - sy;
+            if (sp_b.data[by * sp_b.width + bx] == 1) return true;
+        }
+    }
+    return false;
+}
+
+#ifndef USE_TERMINAL
 void validate_shader(GLuint shader, const char* file = 0) {
     static const unsigned int BUFFER_SIZE = 512;
     char buffer[BUFFER_SIZE];
@@ -127,11 +176,18 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
             break;
     }
 }
+#endif
   
 uint32_t rgb_to_uint32(uint8_t r, uint8_t g, uint8_t b) {
     return (r << 24) | (g << 16) | (b << 8) | 255;
 }
 
+uint64_t monotonic_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
 //clear(set) the buffer to a certain colour
 void buffer_clear(Buffer *buffer, uint32_t color) {
     for (size_t i = 0; i < buffer -> width * buffer -> height; i ++) {
@@ -144,10 +200,12 @@ void buffer_clear(Buffer *buffer, uint32_t color) {
     * Draw the sprite in the buffer with a specified colour. Consider sprite as a bitmap, 1 being the sprite is "On" 
     ! Here moving the sprite to the location (x, y) in the buffer. 
     Bottom-most row & left-most coloumn of the sprite coincides with the (x, y). That is, sprite is built upwards and rightwards from that position. 
+    ! If an id buffer is given, every pixel drawn is also marked with `id` there
          
 */
 
-void buffer_draw_sprite(Buffer* buffer, const Sprite &sprite, size_t x, size_t y, uint32_t color) {
+void buffer_draw_sprite(Buffer* buffer, const Sprite &sprite, size_t x, size_t y, uint32_t color,
+                        IdBuffer *ids = 0, uint16_t id = 0) {
     for (size_t xi = 0; xi < sprite.width; xi ++) {
         for (size_t yi = 0; yi < sprite.height; yi ++) {
             size_t sy = y + sprite.height - 1 - yi;
@@ -156,16 +214,786 @@ void buffer_draw_sprite(Buffer* buffer, const Sprite &sprite, size_t x, size_t y
             if (sprite.data[yi * sprite.width + xi] == 1 
                 && sy < buffer -> height && sx < buffer -> width) {
                     buffer -> data[sy * buffer -> width + sx] = color;
+                    if (ids) ids -> data[sy * ids -> width + sx] = id;
                 }
         }  
     }
 }
 
+void id_buffer_clear(IdBuffer *ids) {
+    memset(ids -> data, 0, ids -> width * ids -> height * sizeof(uint16_t));
+}
+
+/* 
+    * Look up which entity is under the lit pixels of a sprite placed at (x, y), 0 if none
+    ! Costs only as much as the sprite has pixels (3 for a bullet), no matter how many entities were drawn
+*/
+uint16_t id_buffer_sample_sprite(const IdBuffer &ids, const Sprite &sprite, size_t x, size_t y) {
+    for (size_t yi = 0; yi < sprite.height; yi ++) {
+        for (size_t xi = 0; xi < sprite.width; xi ++) {
+            size_t sy = y + sprite.height - 1 - yi;
+            size_t sx = x + xi;
+
+            if (sprite.data[yi * sprite.width + xi] == 1 
+                && sy < ids.height && sx < ids.width) {
+                    uint16_t id = ids.data[sy * ids.width + sx];
+                    if (id) return id;
+                }
+        }
+    }
+    return 0;
+}
+
+/*
+    * Particle system - sparks and debris of explosions, bullet trails
+    ! Stored as a structure of arrays (every field in its own array) so that the same field of 8 (AVX2) or 4 (SSE2)
+      neighbouring particles sits in one register and they are all moved at once. On x86 the widest kernel the CPU
+      supports is picked at runtime, so a plain `g++ -O2` build still gets it. Other CPUs use a plain loop.
+    ! Dead particles are dropped in the same pass by packing the survivors to the front of the arrays
+*/
+#define PARTICLES_MAX 131072
+#define PARTICLE_GRAVITY -0.05f
+
+struct ParticleSystem {
+    size_t count, capacity;
+    float *x, *y;
+    float *vx, *vy;
+    float *life;            // Frames left before the particle dies
+    uint32_t *color;
+    uint32_t rng;           // xorshift state for spreading out emitted particles
+};
+
+#ifdef PARTICLES_X86
+/* For every keep-mask, the lanes to gather so that the kept particles end up at the front */
+static uint32_t particle_pack_lut8[256][8];
+static uint8_t  particle_pack_lut4[16][4];
+static bool particles_use_avx2 = false;
+#endif
+static const char *particles_path = "scalar";
+
+/* Picks the update kernel and fills its lookup tables, only does work on the first call */
+void particles_simd_setup() {
+    static bool done = false;
+    if (done) return;
+    done = true;
+
+#ifdef PARTICLES_X86
+    for (uint32_t mask = 0; mask < 256; mask ++) {
+        size_t n = 0;
+        for (uint32_t lane = 0; lane < 8; lane ++) {
+            if (mask & (1 << lane)) particle_pack_lut8[mask][n ++] = lane;
+        }
+        while (n < 8) particle_pack_lut8[mask][n ++] = 0;
+    }
+    for (uint32_t mask = 0; mask < 16; mask ++) {
+        size_t n = 0;
+        for (uint32_t lane = 0; lane < 4; lane ++) {
+            if (mask & (1 << lane)) particle_pack_lut4[mask][n ++] = lane;
+        }
+        while (n < 4) particle_pack_lut4[mask][n ++] = 0;
+    }
+
+    __builtin_cpu_init();
+    particles_use_avx2 = __builtin_cpu_supports("avx2");
+    particles_path = particles_use_avx2 ? "AVX2" : "SSE2";
+#endif
+}
+
+void particles_init(ParticleSystem *ps, size_t capacity) {
+    ps -> count    = 0;
+    ps -> capacity = capacity;
+    ps -> x     = new float[capacity];
+    ps -> y     = new float[capacity];
+    ps -> vx    = new float[capacity];
+    ps -> vy    = new float[capacity];
+    ps -> life  = new float[capacity];
+    ps -> color = new uint32_t[capacity];
+    ps -> rng   = 0x9E3779B9;
+
+    particles_simd_setup();
+}
+
+void particles_free(ParticleSystem *ps) {
+    delete[] ps -> x;
+    delete[] ps -> y;
+    delete[] ps -> vx;
+    delete[] ps -> vy;
+    delete[] ps -> life;
+    delete[] ps -> color;
+}
+
+/* Random number in [0, 1) */
+float particles_random(ParticleSystem *ps) {
+    ps -> rng ^= ps -> rng << 13;
+    ps -> rng ^= ps -> rng >> 17;
+    ps -> rng ^= ps -> rng << 5;
+    return (ps -> rng >> 8) * (1.0f / 16777216.0f);
+}
+
+void particles_emit(ParticleSystem *ps, float x, float y, float vx, float vy, float life, uint32_t color) {
+    if (ps -> count == ps -> capacity) return;
+
+    size_t i = ps -> count ++;
+    ps -> x[i]     = x;
+    ps -> y[i]     = y;
+    ps -> vx[i]    = vx;
+    ps -> vy[i]    = vy;
+    ps -> life[i]  = life;
+    ps -> color[i] = color;
+}
+
+/* Fast sparks flying out in every direction, and slower debris thrown upwards that falls down */
+void particles_emit_explosion(ParticleSystem *ps, float x, float y, uint32_t spark_color, uint32_t debris_color) {
+    for (int i = 0; i < 48; i ++) {
+        float angle = 6.2831853f * particles_random(ps);
+        float speed = 0.5f + 1.5f * particles_random(ps);
+        particles_emit(ps, x, y, speed * cosf(angle), speed * sinf(angle),
+                       10.0f + 10.0f * particles_random(ps), spark_color);
+    }
+    for (int i = 0; i < 16; i ++) {
+        particles_emit(ps, x, y, particles_random(ps) - 0.5f, 1.2f * particles_random(ps),
+                       30.0f + 30.0f * particles_random(ps), debris_color);
+    }
+}
+
+/* A couple of short lived particles left behind a bullet every frame */
+void particles_emit_trail(ParticleSystem *ps, float x, float y, uint32_t color) {
+    for (int i = 0; i < 2; i ++) {
+        particles_emit(ps, x, y, 0.3f * (particles_random(ps) - 0.5f), -0.3f * particles_random(ps),
+                       6.0f + 6.0f * particles_random(ps), color);
+    }
+}
+
+#ifdef PARTICLES_X86
+/*
+    * The kernels below move whole groups of 8 / 4 particles and return how far they got, particles_update does the rest
+    ! They compute exactly what the plain loop does (same float operations, same order), only several lanes at once
+*/
+__attribute__((target("avx2")))
+size_t particles_update_avx2(ParticleSystem *ps, float width, float height, size_t *alive_out) {
+    const __m256 gravity = _mm256_set1_ps(PARTICLE_GRAVITY);
+    const __m256 one     = _mm256_set1_ps(1.0f);
+    const __m256 zero    = _mm256_setzero_ps();
+    const __m256 right   = _mm256_set1_ps(width);
+    const __m256 top     = _mm256_set1_ps(height);
+
+    size_t alive = 0;
+    size_t i = 0;
+    for (; i + 8 <= ps -> count; i += 8) {
+        __m256 vx   = _mm256_loadu_ps(ps -> vx + i);
+        __m256 vy   = _mm256_add_ps(_mm256_loadu_ps(ps -> vy + i), gravity);
+        __m256 x    = _mm256_add_ps(_mm256_loadu_ps(ps -> x + i), vx);
+        __m256 y    = _mm256_add_ps(_mm256_loadu_ps(ps -> y + i), vy);
+        __m256 life = _mm256_sub_ps(_mm256_loadu_ps(ps -> life + i), one);
+        __m256i color = _mm256_loadu_si256((const __m256i *)(ps -> color + i));
+
+        __m256 keep = _mm256_cmp_ps(life, zero, _CMP_GT_OQ);
+        keep = _mm256_and_ps(keep, _mm256_cmp_ps(x, zero, _CMP_GE_OQ));
+        keep = _mm256_and_ps(keep, _mm256_cmp_ps(x, right, _CMP_LT_OQ));
+        keep = _mm256_and_ps(keep, _mm256_cmp_ps(y, zero, _CMP_GE_OQ));
+        keep = _mm256_and_ps(keep, _mm256_cmp_ps(y, top, _CMP_LT_OQ));
+        int mask = _mm256_movemask_ps(keep);
+
+        __m256i pack = _mm256_loadu_si256((const __m256i *)particle_pack_lut8[mask]);
+        _mm256_storeu_ps(ps -> x + alive,    _mm256_permutevar8x32_ps(x, pack));
+        _mm256_storeu_ps(ps -> y + alive,    _mm256_permutevar8x32_ps(y, pack));
+        _mm256_storeu_ps(ps -> vx + alive,   _mm256_permutevar8x32_ps(vx, pack));
+        _mm256_storeu_ps(ps -> vy + alive,   _mm256_permutevar8x32_ps(vy, pack));
+        _mm256_storeu_ps(ps -> life + alive, _mm256_permutevar8x32_ps(life, pack));
+        _mm256_storeu_si256((__m256i *)(ps -> color + alive), _mm256_permutevar8x32_epi32(color, pack));
+        alive += __builtin_popcount(mask);
+    }
+
+    *alive_out = alive;
+    return i;
+}
+
+/*
+    ! SSE2 has no lane shuffle driven by a register, so a group where every particle survives (by far the common case)
+      is stored as whole vectors and any other group copies its surviving lanes one by one through the lookup table
+*/
+size_t particles_update_sse2(ParticleSystem *ps, float width, float height, size_t *alive_out) {
+    const __m128 gravity = _mm_set1_ps(PARTICLE_GRAVITY);
+    const __m128 one     = _mm_set1_ps(1.0f);
+    const __m128 zero    = _mm_setzero_ps();
+    const __m128 right   = _mm_set1_ps(width);
+    const __m128 top     = _mm_set1_ps(height);
+
+    size_t alive = 0;
+    size_t i = 0;
+    for (; i + 4 <= ps -> count; i += 4) {
+        __m128 vx   = _mm_loadu_ps(ps -> vx + i);
+        __m128 vy   = _mm_add_ps(_mm_loadu_ps(ps -> vy + i), gravity);
+        __m128 x    = _mm_add_ps(_mm_loadu_ps(ps -> x + i), vx);
+        __m128 y    = _mm_add_ps(_mm_loadu_ps(ps -> y + i), vy);
+        __m128 life = _mm_sub_ps(_mm_loadu_ps(ps -> life + i), one);
+        __m128i color = _mm_loadu_si128((const __m128i *)(ps -> color + i));
+
+        __m128 keep = _mm_cmpgt_ps(life, zero);
+        keep = _mm_and_ps(keep, _mm_cmpge_ps(x, zero));
+        keep = _mm_and_ps(keep, _mm_cmplt_ps(x, right));
+        keep = _mm_and_ps(keep, _mm_cmpge_ps(y, zero));
+        keep = _mm_and_ps(keep, _mm_cmplt_ps(y, top));
+        int mask = _mm_movemask_ps(keep);
+
+        if (mask == 0xF) {
+            _mm_storeu_ps(ps -> x + alive,    x);
+            _mm_storeu_ps(ps -> y + alive,    y);
+            _mm_storeu_ps(ps -> vx + alive,   vx);
+            _mm_storeu_ps(ps -> vy + alive,   vy);
+            _mm_storeu_ps(ps -> life + alive, life);
+            _mm_storeu_si128((__m128i *)(ps -> color + alive), color);
+            alive += 4;
+        }
+        else if (mask != 0) {
+            float lx[4], ly[4], lvx[4], lvy[4], llife[4];
+            uint32_t lcolor[4];
+            _mm_storeu_ps(lx, x);
+            _mm_storeu_ps(ly, y);
+            _mm_storeu_ps(lvx, vx);
+            _mm_storeu_ps(lvy, vy);
+            _mm_storeu_ps(llife, life);
+            _mm_storeu_si128((__m128i *)lcolor, color);
+
+            int kept = __builtin_popcount(mask);
+            for (int k = 0; k < kept; k ++) {
+                int lane = particle_pack_lut4[mask][k];
+                ps -> x[alive]     = lx[lane];
+                ps -> y[alive]     = ly[lane];
+                ps -> vx[alive]    = lvx[lane];
+                ps -> vy[alive]    = lvy[lane];
+                ps -> life[alive]  = llife[lane];
+                ps -> color[alive] = lcolor[lane];
+                ++ alive;
+            }
+        }
+    }
+
+    *alive_out = alive;
+    return i;
+}
+#endif
+
+/*
+    * Move every particle one frame forward and drop the ones that died or left the (width x height) screen
+    ! Survivors are written back at index `alive`, which never gets ahead of the index being read, so it can be done in place
+*/
+void particles_update(ParticleSystem *ps, float width, float height) {
+    size_t alive = 0;
+    size_t i = 0;
+
+#ifdef PARTICLES_X86
+    if (particles_use_avx2) i = particles_update_avx2(ps, width, height, &alive);
+    else i = particles_update_sse2(ps, width, height, &alive);
+#endif
+
+    for (; i < ps -> count; i ++) {
+        float vy   = ps -> vy[i] + PARTICLE_GRAVITY;
+        float x    = ps -> x[i] + ps -> vx[i];
+        float y    = ps -> y[i] + vy;
+        float life = ps -> life[i] - 1.0f;
+        if (!(life > 0.0f && x >= 0.0f && x < width && y >= 0.0f && y < height)) continue;
+
+        ps -> x[alive]     = x;
+        ps -> y[alive]     = y;
+        ps -> vx[alive]    = ps -> vx[i];
+        ps -> vy[alive]    = vy;
+        ps -> life[alive]  = life;
+        ps -> color[alive] = ps -> color[i];
+        ++ alive;
+    }
+
+    ps -> count = alive;
+}
+
+/* Add two pixels channel by channel, clamping at 255 instead of wrapping around */
+uint32_t rgb_add_saturate(uint32_t a, uint32_t b) {
+    uint32_t r = ((a >> 24) & 0xFF) + ((b >> 24) & 0xFF);
+    uint32_t g = ((a >> 16) & 0xFF) + ((b >> 16) & 0xFF);
+    uint32_t bl = ((a >> 8) & 0xFF) + ((b >> 8) & 0xFF);
+    return rgb_to_uint32(r > 255 ? 255 : r, g > 255 ? 255 : g, bl > 255 ? 255 : bl);
+}
+
+/* Draw every particle as a single pixel, added on top of what is already in the buffer */
+void buffer_splat_particles(Buffer *buffer, const ParticleSystem &ps) {
+    for (size_t i = 0; i < ps.count; i ++) {
+        float x = ps.x[i], y = ps.y[i];
+        if (!(x >= 0.0f && y >= 0.0f)) continue;
+
+        // Through int: float to unsigned 64 bit conversion is a slow instruction sequence on x86
+        size_t sx = (int)x, sy = (int)y;
+        if (sx < buffer -> width && sy < buffer -> height) {
+            uint32_t &pixel = buffer -> data[sy * buffer -> width + sx];
+            pixel = rgb_add_saturate(pixel, ps.color[i]);
+        }
+    }
+}
+
+/*
+    * Benchmark (./main --bench-particles) - keeps ~120k particles alive over the game screen and
+      times particles_update and buffer_splat_particles against the budget of one 60 fps frame
+*/
+int particles_benchmark() {
+    const size_t target = 120000;
+    const size_t frames = 1000;
+    const float width = 224, height = 256;
+
+    Buffer buffer;
+    buffer.width  = (size_t)width;
+    buffer.height = (size_t)height;
+    buffer.data   = new uint32_t[buffer.width * buffer.height];
+
+    ParticleSystem ps;
+    particles_init(&ps, PARTICLES_MAX);
+
+    uint64_t update_ns = 0, splat_ns = 0;
+    size_t updated = 0, splatted = 0;
+
+    for (size_t frame = 0; frame < frames; frame ++) {
+        while (ps.count < target) {
+            particles_emit_explosion(&ps, width * particles_random(&ps), height * particles_random(&ps),
+                                     rgb_to_uint32(96, 48, 0), rgb_to_uint32(48, 48, 48));
+        }
+        buffer_clear(&buffer, rgb_to_uint32(0, 128, 0));
+
+        updated += ps.count;
+        uint64_t start = monotonic_ns();
+        particles_update(&ps, width, height);
+        uint64_t mid = monotonic_ns();
+        buffer_splat_particles(&buffer, ps);
+        splatted += ps.count;
+        uint64_t end = monotonic_ns();
+
+        update_ns += mid - start;
+        splat_ns  += end - mid;
+    }
+
+    const char *path = particles_path;
+    printf("Particle benchmark (%s): %zu frames, %zu particles/frame avg\n", path, frames, updated / frames);
+    printf("  update: %.2f particles/ns, %.1f us/frame\n", (double)updated / update_ns, update_ns / 1000.0 / frames);
+    printf("  splat : %.2f particles/ns, %.1f us/frame\n", (double)splatted / splat_ns, splat_ns / 1000.0 / frames);
+    printf("  frame budget used: %.1f%% of 16.7 ms\n", (update_ns + splat_ns) / 1e6 / frames / 16.667 * 100.0);
+
+    particles_free(&ps);
+    delete[] buffer.data;
+    return 0;
+}
+
+/*
+    * Self test (./main --test-collisions) - draws random sprites into a Buffer + IdBuffer and checks that
+      id_buffer_sample_sprite finds exactly the hits that sprite_pixel_overlap_check finds for bullets thrown at them
+    ! Sprites are placed in separate 16x16 cells like the alien grid, so no pixel is owned by two of them
+*/
+int collision_self_test() {
+    const size_t cells_x = 14, cells_y = 16;
+    const size_t num_targets = cells_x * cells_y;
+    const size_t trials = 200000;
+
+    Buffer buffer;
+    buffer.width  = 16 * cells_x;
+    buffer.height = 16 * cells_y;
+    buffer.data   = new uint32_t[buffer.width * buffer.height];
+
+    IdBuffer ids;
+    ids.width  = buffer.width;
+    ids.height = buffer.height;
+    ids.data   = new uint16_t[ids.width * ids.height];
+
+    Sprite *targets = new Sprite[num_targets];
+    size_t *target_x = new size_t[num_targets];
+    size_t *target_y = new size_t[num_targets];
+
+    Sprite bullet;
+    bullet.data = new uint8_t[3 * 4];
+
+    srand(1234);
+    size_t hits = 0, failures = 0;
+
+    for (size_t round = 0; round < 20; round ++) {
+        buffer_clear(&buffer, rgb_to_uint32(0, 128, 0));
+        id_buffer_clear(&ids);
+
+        for (size_t t = 0; t < num_targets; t ++) {
+            Sprite &sprite = targets[t];
+            if (round > 0) delete[] sprite.data;
+            sprite.width  = 1 + rand() % 13;
+            sprite.height = 1 + rand() % 8;
+            sprite.data   = new uint8_t[sprite.width * sprite.height];
+            for (size_t i = 0; i < sprite.width * sprite.height; i ++) sprite.data[i] = rand() % 2;
+
+            target_x[t] = 16 * (t % cells_x) + rand() % (16 - sprite.width + 1);
+            target_y[t] = 16 * (t / cells_x) + rand() % (16 - sprite.height + 1);
+            buffer_draw_sprite(&buffer, sprite, target_x[t], target_y[t], rgb_to_uint32(128, 0, 0), &ids, t + 1);
+        }
+
+        for (size_t trial = 0; trial < trials / 20; trial ++) {
+            bullet.width  = 1 + rand() % 3;
+            bullet.height = 1 + rand() % 4;
+            for (size_t i = 0; i < bullet.width * bullet.height; i ++) bullet.data[i] = rand() % 2;
+            size_t x = rand() % (buffer.width - bullet.width + 1);
+            size_t y = rand() % (buffer.height - bullet.height + 1);
+
+            uint16_t id = id_buffer_sample_sprite(ids, bullet, x, y);
+
+            bool any_hit = false, id_matches = false;
+            for (size_t t = 0; t < num_targets; t ++) {
+                if (sprite_pixel_overlap_check(bullet, x, y, targets[t], target_x[t], target_y[t])) {
+                    any_hit = true;
+                    if (id == t + 1) id_matches = true;
+                }
+            }
+
+            if (any_hit) ++ hits;
+            if (any_hit != (id != 0) || (any_hit && !id_matches)) {
+                if (failures < 10) {
+                    fprintf(stderr, "Mismatch: bullet %zux%zu at (%zu, %zu), id buffer says %d\n",
+                            bullet.width, bullet.height, x, y, id);
+                }
+                ++ failures;
+            }
+        }
+    }
+
+    printf("Collision test: %zu bullets, %zu hits, %zu mismatches\n", trials, hits, failures);
+
+    for (size_t t = 0; t < num_targets; t ++) delete[] targets[t].data;
+    delete[] targets;
+    delete[] target_x;
+    delete[] target_y;
+    delete[] bullet.data;
+    delete[] ids.data;
+    delete[] buffer.data;
+    return failures == 0 ? 0 : 1;
+}
+
+#ifdef USE_TERMINAL
+/*
+    * Terminal presenter - shows the finished buffer as text so the game can run without a display (e.g. over ssh)
+    ! Each character cell covers two pixels stacked on top of each other. The upper half block glyph is drawn with the
+      top pixel as foreground colour and the bottom pixel as background colour.
+    ! Only the cells that changed since the last frame are sent, and the whole frame goes out in one write()
+*/
+#define TERMINAL_FRAME_NS 16666667      // ~60 frames per second, stands in for VSync
+/*
+    * Terminals report no key release, only the key again and again while it is held (auto repeat). So an arrow keeps
+      the player moving for a while after each press:
+    ! After the first press, for longer than the usual delay before auto repeat starts (250 - 600 ms), so holding
+      the key does not stop and go. The price is that a single tap moves the player for that long as well.
+    ! Once repeats arrive (same key again while still moving), only a little longer than the gap between repeats
+      plus some ssh jitter, so the player stops soon after the key is let go.
+*/
+#define TERMINAL_KEY_FIRST_HOLD_FRAMES  36     // ~600 ms
+#define TERMINAL_KEY_REPEAT_HOLD_FRAMES 6      // ~100 ms
+
+struct TerminalPresenter {
+    size_t cols, rows;
+    size_t visible_cols, visible_rows;  // Part of the cells that fits in the terminal window, the rest is clipped
+    uint64_t *cells;            // (top pixel << 32 | bottom pixel) of every cell as last sent to the terminal
+    char *out;                  // Holds the escape sequences of one frame before they are written
+    size_t out_capacity;
+
+    size_t frames;
+    size_t bytes_first;         // The first frame sends every cell, kept apart so it does not hide the per frame numbers
+    size_t bytes_total, bytes_max;  // Over every frame after the first
+    uint64_t present_ns_total, present_ns_max;
+};
+
+/* Worst case for a cell: cursor move + foreground colour + background colour + 3 byte glyph */
+static const size_t TERMINAL_CELL_MAX_BYTES = sizeof("\x1b[65535;65535H") + 2 * sizeof("\x1b[38;2;255;255;255m") + 3;
+
+char* append_str(char *out, const char *str, size_t length) {
+    memcpy(out, str, length);
+    return out + length;
+}
+
+char* append_uint(char *out, size_t value) {
+    char digits[20];
+    size_t n = 0;
+    do {
+        digits[n ++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    while (n) *out ++ = digits[-- n];
+    return out;
+}
+
+/* Pixel is (r | g | b | alpha), write its r;g;b part of the colour escape sequence */
+char* append_rgb(char *out, uint32_t pixel) {
+    out = append_uint(out, (pixel >> 24) & 0xFF);
+    *out ++ = ';';
+    out = append_uint(out, (pixel >> 16) & 0xFF);
+    *out ++ = ';';
+    out = append_uint(out, (pixel >> 8) & 0xFF);
+    *out ++ = 'm';
+    return out;
+}
+
+/* write() may accept only part of a large frame, keep going until everything is out */
+bool write_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data   += written;
+        length -= written;
+    }
+    return true;
+}
+
+/*
+    * Terminal state shared with the signal handler. Signal handlers may only set volatile sig_atomic_t flags and
+      call async-signal-safe functions (write, tcsetattr, ...), so the game loop polls terminal_quit / terminal_resumed.
+*/
+static volatile sig_atomic_t terminal_quit    = 0;
+static volatile sig_atomic_t terminal_resumed = 0;
+static volatile sig_atomic_t terminal_resized = 0;
+static volatile sig_atomic_t terminal_active  = 0;
+static termios terminal_saved_termios, terminal_raw_termios;
+
+static const char terminal_init_seq[]  = "\x1b[?25l\x1b[2J";                  // Hide the cursor and clear the screen
+static const char terminal_reset_seq[] = "\x1b[0m\x1b[2J\x1b[H\x1b[?25h";   // Default colours, clear, show the cursor
+
+/* Give the user their terminal back: cooked mode with echo and a visible cursor. Safe to call from a signal handler */
+void terminal_restore() {
+    if (!terminal_active) return;
+    terminal_active = 0;
+    write_all(STDOUT_FILENO, terminal_reset_seq, sizeof(terminal_reset_seq) - 1);
+    tcsetattr(STDIN_FILENO, TCSANOW, &terminal_saved_termios);
+}
+
+void terminal_enter_raw() {
+    tcsetattr(STDIN_FILENO, TCSANOW, &terminal_raw_termios);
+    write_all(STDOUT_FILENO, terminal_init_seq, sizeof(terminal_init_seq) - 1);
+    terminal_active = 1;
+}
+
+/*
+    * SIGTSTP (Ctrl-Z): restore the terminal, stop for real, and take it over again once continued
+    ! The screen was used by someone else meanwhile, so terminal_resumed asks the presenter for a full redraw
+    * SIGWINCH: the window was resized and the terminal may have reflowed or cleared it, so ask for a full redraw
+    * SIGINT, SIGTERM, SIGHUP (e.g. the ssh session dropped): ask the game loop to end, it cleans up on the way out
+*/
+void terminal_signal_handler(int sig) {
+    int saved_errno = errno;
+    if (sig == SIGTSTP) {
+        terminal_restore();
+
+        signal(SIGTSTP, SIG_DFL);
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGTSTP);
+        sigprocmask(SIG_UNBLOCK, &mask, NULL);
+        raise(SIGTSTP);                         // Stops here until SIGCONT
+        signal(SIGTSTP, terminal_signal_handler);
+
+        terminal_enter_raw();
+        terminal_resumed = 1;
+    }
+    else if (sig == SIGWINCH) terminal_resized = 1;
+    else terminal_quit = 1;
+    errno = saved_errno;
+}
+
+/* Clip the drawn cells to the window, so a small terminal shows part of the screen rather than wrapped lines */
+void terminal_read_size(TerminalPresenter *term) {
+    term -> visible_cols = term -> cols;
+    term -> visible_rows = term -> rows;
+
+    winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0 && ws.ws_row > 0) {
+        if (ws.ws_col < term -> visible_cols) term -> visible_cols = ws.ws_col;
+        if (ws.ws_row < term -> visible_rows) term -> visible_rows = ws.ws_row;
+    }
+}
+
+bool terminal_init(TerminalPresenter *term, const Buffer &buffer) {
+    if (!isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO)) {
+        fprintf(stderr, "Terminal renderer needs an interactive terminal.\n");
+        return false;
+    }
+
+    term -> cols = buffer.width;
+    term -> rows = (buffer.height + 1) / 2;
+
+    terminal_read_size(term);
+
+    // Raw mode: no echo, no line buffering and read() returns at once even when no key was pressed
+    tcgetattr(STDIN_FILENO, &terminal_saved_termios);
+    terminal_raw_termios = terminal_saved_termios;
+    terminal_raw_termios.c_lflag &= ~(ICANON | ECHO);
+    terminal_raw_termios.c_cc[VMIN]  = 0;
+    terminal_raw_termios.c_cc[VTIME] = 0;
+
+    signal(SIGINT, terminal_signal_handler);
+    signal(SIGTERM, terminal_signal_handler);
+    signal(SIGHUP, terminal_signal_handler);
+    signal(SIGTSTP, terminal_signal_handler);
+    signal(SIGWINCH, terminal_signal_handler);
+    atexit(terminal_restore);       // Also covers leaving through exit() anywhere else
+
+    // Alpha is always 255 in a drawn pixel, so 0 never matches and the first frame sends every cell
+    term -> cells = new uint64_t[term -> cols * term -> rows];
+    memset(term -> cells, 0, term -> cols * term -> rows * sizeof(uint64_t));
+
+    term -> out_capacity = term -> cols * term -> rows * TERMINAL_CELL_MAX_BYTES + 64;
+    term -> out = new char[term -> out_capacity];
+
+    term -> frames = 0;
+    term -> bytes_first = term -> bytes_total = term -> bytes_max = 0;
+    term -> present_ns_total = term -> present_ns_max = 0;
+
+    terminal_enter_raw();
+    return true;
+}
+
+/*
+    * Send the buffer to the terminal, writing only the cells that changed since the previous call
+    ! Buffer row 0 is the bottom of the screen while terminal row 0 is the top, hence the flip
+    ! Cursor position and current colours are tracked so that runs of changed cells need no extra escape sequences
+*/
+void terminal_present(TerminalPresenter *term, const Buffer &buffer) {
+    uint64_t start = monotonic_ns();
+
+    char *out = term -> out;
+
+    // Back from Ctrl-Z or resized: what is on screen is unknown, so clear it and send every cell again
+    if (terminal_resumed || terminal_resized) {
+        if (terminal_resized) terminal_read_size(term);
+        terminal_resumed = terminal_resized = 0;
+        memset(term -> cells, 0, term -> cols * term -> rows * sizeof(uint64_t));
+        out = append_str(out, "\x1b[0m\x1b[2J", 8);
+    }
+
+    size_t cursor_row = (size_t)-1, cursor_col = (size_t)-1;
+    uint32_t fg = 0, bg = 0;
+
+    for (size_t row = 0; row < term -> visible_rows; row ++) {
+        size_t top_y = buffer.height - 1 - 2 * row;
+        const uint32_t *top    = buffer.data + top_y * buffer.width;
+        const uint32_t *bottom = top_y > 0 ? top - buffer.width : 0;
+        uint64_t *cells = term -> cells + row * term -> cols;
+
+        for (size_t col = 0; col < term -> visible_cols; col ++) {
+            uint32_t top_pixel    = top[col];
+            uint32_t bottom_pixel = bottom ? bottom[col] : top_pixel;
+            uint64_t cell = (uint64_t)top_pixel << 32 | bottom_pixel;
+            if (cells[col] == cell) continue;
+            cells[col] = cell;
+
+            if (row != cursor_row || col != cursor_col) {
+                out = append_str(out, "\x1b[", 2);
+                out = append_uint(out, row + 1);
+                *out ++ = ';';
+                out = append_uint(out, col + 1);
+                *out ++ = 'H';
+            }
+            if (top_pixel != fg) {
+                out = append_str(out, "\x1b[38;2;", 7);
+                out = append_rgb(out, top_pixel);
+                fg = top_pixel;
+            }
+            if (bottom_pixel != bg) {
+                out = append_str(out, "\x1b[48;2;", 7);
+                out = append_rgb(out, bottom_pixel);
+                bg = bottom_pixel;
+            }
+            out = append_str(out, "\xe2\x96\x80", 3);   // U+2580 upper half block
+
+            cursor_row = row;
+            cursor_col = col + 1;
+        }
+    }
+
+    size_t bytes = out - term -> out;
+    if (bytes > 0) {
+        write_all(STDOUT_FILENO, term -> out, bytes);
+    }
+
+    uint64_t elapsed = monotonic_ns() - start;
+    if (term -> frames ++ == 0) term -> bytes_first = bytes;
+    else {
+        term -> bytes_total += bytes;
+        if (bytes > term -> bytes_max) term -> bytes_max = bytes;
+    }
+    term -> present_ns_total += elapsed;
+    if (elapsed > term -> present_ns_max) term -> present_ns_max = elapsed;
+}
+
+/* 
+    * Read every pending key without blocking. Arrow keys arrive as "ESC [ C" (right) and "ESC [ D" (left)
+    ! A sequence can be split over two reads (e.g. by ssh), so how far into it we are is kept between calls.
+      For the same reason a bare ESC is not a quit key here, only 'q' is.
+*/
+void terminal_poll_input() {
+    static int hold = 0;
+    static int escape = 0;      // 0: no sequence, 1: got ESC, 2: got "ESC [" or "ESC O"
+    int dir = 0;
+
+    char keys[64];
+    ssize_t n;
+    while ((n = read(STDIN_FILENO, keys, sizeof(keys))) > 0) {
+        for (ssize_t i = 0; i < n; i ++) {
+            char key = keys[i];
+            if (escape == 1) {
+                escape = (key == '[' || key == 'O') ? 2 : 0;
+                if (escape) continue;
+            }
+            else if (escape == 2) {
+                // Parameters of the sequence are digits and ';', anything else ends it
+                if ((key >= '0' && key <= '9') || key == ';') continue;
+                if (key == 'C') dir = 1;
+                else if (key == 'D') dir = -1;
+                escape = 0;
+                continue;
+            }
+
+            if (key == '\x1b') escape = 1;
+            else if (key == 'q') game_running = false;
+            else if (key == ' ') fire_pressed = true;
+        }
+    }
+
+    if (dir != 0) {
+        bool repeat = (dir == mov_dir && hold > 0);
+        mov_dir = dir;
+        hold = repeat ? TERMINAL_KEY_REPEAT_HOLD_FRAMES : TERMINAL_KEY_FIRST_HOLD_FRAMES;
+    }
+    else if (hold > 0) -- hold;
+    else mov_dir = 0;
+}
+
+/* Restore the terminal and report how much the presenter had to send */
+void terminal_shutdown(TerminalPresenter *term) {
+    terminal_restore();
+
+    if (term -> frames > 0) {
+        size_t diff_frames = term -> frames > 1 ? term -> frames - 1 : 1;
+        printf("Terminal renderer: %zu frames, %zu bytes/frame avg (%zu max, %zu first), present %.1f us avg (%.1f us max)\n",
+               term -> frames,
+               term -> bytes_total / diff_frames, term -> bytes_max, term -> bytes_first,
+               term -> present_ns_total / 1000.0 / term -> frames, term -> present_ns_max / 1000.0);
+    }
+
+    delete[] term -> cells;
+    delete[] term -> out;
+}
+#endif
+
 int main(int argc, char* argv[]) {
 
+    if (argc > 1 && strcmp(argv[1], "--bench-particles") == 0) {
+        return particles_benchmark();
+    }
+    if (argc > 1 && strcmp(argv[1], "--test-collisions") == 0) {
+        return collision_self_test();
+    }
+
     const size_t buffer_width = 224;
     const size_t buffer_height = 256;
 
+#ifndef USE_TERMINAL
     glfwSetErrorCallback(error_callback);
 
     if (!glfwInit()) {
@@ -222,6 +1050,7 @@ int main(int argc, char* argv[]) {
 
     /* Turing On VSync*/
     glfwSwapInterval(1);
+#endif
     
     /* 
         * Buffer -> 
@@ -239,6 +1068,7 @@ int main(int argc, char* argv[]) {
     buffer.data   = new uint32_t[buffer.width * buffer.height];
     buffer_clear(&buffer, clear_color); 
 
+#ifndef USE_TERMINAL
     /*
         * Texture - Used to tranfer image data to GPU. In case of VAO, it's also an object of VAO holding all the info on vertex
         ! Purpose being that the shader programs, which runs in GPU, use the texture to sample / look up the image it wants to render
@@ -354,6 +1184,13 @@ int main(int argc, char* argv[]) {
     glDisable(GL_DEPTH_TEST);
     glActiveTexture(GL_TEXTURE0);
     glBindVertexArray(fullscreen_triangle_vao);
+#else
+    TerminalPresenter terminal;
+    if (!terminal_init(&terminal, buffer)) {
+        delete[] buffer.data;
+        return -1;
+    }
+#endif
 
 
 
@@ -540,6 +1377,16 @@ int main(int argc, char* argv[]) {
         death_counters[i] = 10;
     }
 
+    /* Particles for explosions and bullet trails */
+    ParticleSystem particles;
+    particles_init(&particles, PARTICLES_MAX);
+
+    /* Which alien owns each pixel of the buffer, filled while drawing and used to find what bullets hit */
+    IdBuffer alien_ids;
+    alien_ids.width  = buffer.width;
+    alien_ids.height = buffer.height;
+    alien_ids.data   = new uint16_t[alien_ids.width * alien_ids.height];
+
     /* fill alien positions */
     
     for (size_t yi = 0; yi < 5; ++yi) {
@@ -560,9 +1407,15 @@ int main(int argc, char* argv[]) {
     */
     game_running = true;
 
+#ifndef USE_TERMINAL
     while (!glfwWindowShouldClose(window) && game_running) {
+#else
+    uint64_t next_frame = monotonic_ns() + TERMINAL_FRAME_NS;
+    while (game_running && !terminal_quit) {
+#endif
 
         buffer_clear(&buffer, clear_color);
+        id_buffer_clear(&alien_ids);
 
         // Draw
 
@@ -582,7 +1435,8 @@ int main(int argc, char* argv[]) {
                 const Sprite &sprite = *animation.frames[current_frame]; 
                 buffer_draw_sprite(&buffer, sprite, 
                                     alien.x, alien.y, 
-                                    rgb_to_uint32(128, 0, 0));
+                                    rgb_to_uint32(128, 0, 0),
+                                    &alien_ids, ai + 1);
             }
         }
 
@@ -597,6 +1451,8 @@ int main(int argc, char* argv[]) {
                                 bullet.x, bullet.y, 
                                 rgb_to_uint32(128, 0, 0));
         }
+
+        buffer_splat_particles(&buffer, particles);
         
         /* Updating animation */
         for (int i = 0; i < 3; i ++) {
@@ -606,6 +1462,7 @@ int main(int argc, char* argv[]) {
             }
         }
     
+#ifndef USE_TERMINAL
         glTexSubImage2D(
             GL_TEXTURE_2D, 0, 0, 0,
             buffer.width, buffer.height,
@@ -616,6 +1473,20 @@ int main(int argc, char* argv[]) {
         glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 
         glfwSwapBuffers(window);
+#else
+        terminal_present(&terminal, buffer);
+
+        /* No VSync in a terminal, sleep away the rest of the frame instead */
+        uint64_t now = monotonic_ns();
+        if (now < next_frame) {
+            timespec wait;
+            wait.tv_sec  = (next_frame - now) / 1000000000ull;
+            wait.tv_nsec = (next_frame - now) % 1000000000ull;
+            nanosleep(&wait, NULL);
+            next_frame += TERMINAL_FRAME_NS;
+        }
+        else next_frame = now + TERMINAL_FRAME_NS;
+#endif
 
         /* Simulate aliens*/
         for (size_t ai = 0; ai < game.num_aliens; ++ai) {
@@ -625,6 +1496,9 @@ int main(int argc, char* argv[]) {
             }
         }
 
+        /* Simulate particles */
+        particles_update(&particles, (float)game.width, (float)game.height);
+
         /* Simulate player */
         int player_mov_dir = 2 * mov_dir;
         if (player_mov_dir != 0) {
@@ -645,27 +1519,27 @@ int main(int argc, char* argv[]) {
                 -- game.num_bullets;
                 continue;
             }
-
-            // Check if bullet has hit the alien
-            for (size_t ai = 0; ai < game.num_aliens; ++ai) {
-                const Alien &alien = game.aliens[ai];
-                if (alien.type == ALIEN_DEAD) 
-                    continue;
-                
-                const SpriteAnimation &animation = alien_animation[alien.type - 1];
-                size_t current_frame = animation.time / animation.frame_duration;
-                const Sprite& alien_sprite = *animation.frames[current_frame];
-
-                bool overlap = sprite_overlap_check(bullet_sprite, game.bullets[bi].x, game.bullets[bi].y,
-                                            alien_sprite, alien.x, alien.y);
-                if (overlap) {
-                    game.aliens[ai].type = ALIEN_DEAD;
-                    game.aliens[ai].x -= (alien_death_sprite.width - alien_sprite.width) / 2;
-                    game.bullets[bi] = game.bullets[game.num_bullets - 1];
-                    --game.num_bullets;
-                    continue;
-                }
-
+            particles_emit_trail(&particles, (float)game.bullets[bi].x, (float)game.bullets[bi].y - 1.0f,
+                                 rgb_to_uint32(64, 64, 0));
+
+            /* 
+                Check if bullet has hit the alien by looking up the pixels under the bullet in the id buffer of this frame.
+                Pixel exact against the sprite shape that was drawn, and no need to go through all the aliens.
+                An alien killed by another bullet this frame is still in the id buffer, hence the ALIEN_DEAD check.
+            */
+            uint16_t hit_id = id_buffer_sample_sprite(alien_ids, bullet_sprite, game.bullets[bi].x, game.bullets[bi].y);
+            if (hit_id && game.aliens[hit_id - 1].type != ALIEN_DEAD) {
+                Alien &alien = game.aliens[hit_id - 1];
+                const Sprite& alien_sprite = *alien_animation[alien.type - 1].frames[0];
+
+                particles_emit_explosion(&particles,
+                                         alien.x + alien_sprite.width / 2.0f, alien.y + alien_sprite.height / 2.0f,
+                                         rgb_to_uint32(128, 64, 0), rgb_to_uint32(64, 0, 0));
+                alien.type = ALIEN_DEAD;
+                alien.x -= (alien_death_sprite.width - alien_sprite.width) / 2;
+                game.bullets[bi] = game.bullets[game.num_bullets - 1];
+                --game.num_bullets;
+                continue;
             }
             ++ bi;
         } 
@@ -679,13 +1553,21 @@ int main(int argc, char* argv[]) {
         }
         fire_pressed = false;
 
+#ifndef USE_TERMINAL
         glfwPollEvents();   
+#else
+        terminal_poll_input();
+#endif
     }
 
+#ifndef USE_TERMINAL
     glfwDestroyWindow(window);
     glfwTerminate();
     
     glDeleteVertexArrays(1, &fullscreen_triangle_vao);
+#else
+    terminal_shutdown(&terminal);
+#endif
 
     for(size_t i = 0; i < 6; ++i)
     {
@@ -701,6 +1583,8 @@ int main(int argc, char* argv[]) {
     delete[] buffer.data;
     delete[] game.aliens;
     delete[] death_counters;
+    particles_free(&particles);
+    delete[] alien_ids.data;
 
     return 0;
 }
\ No newline at end of file